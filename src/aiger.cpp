@@ -173,7 +173,8 @@ void expand(std::ostream &o, const std::vector<unsigned> &c,
             aiger_symbol *first_symbol, unsigned n) {
   if (!first_symbol) return;
   L3 << "expand" << c << "from" << first_symbol->lit << "to length" << n;
-  unsigned i = (first_symbol->lit / 2) + 1;
+  const unsigned first = first_symbol->lit / 2;
+  unsigned i = first;
   for (auto l : c) {
     const unsigned v = l / 2;
     for (; i < v; i++)
@@ -181,7 +182,7 @@ void expand(std::ostream &o, const std::vector<unsigned> &c,
     o << (~l & 1u);
     i += 1;
   }
-  for (; i < n; i++)
+  for (; i < first + n; i++)
     o << 'x';
 }
 
@@ -199,7 +200,7 @@ void write_witness(aiger *model, const std::vector<std::vector<unsigned>> &cex,
   }
   std::ostream &o = (path ? f : std::cout);
   o << "1\nb0\n";
-  expand(o, cex[0], model->latches, model->num_inputs + model->num_latches);
+  expand(o, cex[0], model->latches, model->num_latches);
   o << "\n";
   for (unsigned i = 1; i < cex.size(); ++i) {
     expand(o, cex[i], model->inputs, model->num_inputs);
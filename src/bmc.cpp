@@ -0,0 +1,16 @@
+#include "bmc.hpp"
+#include "mcaiger.hpp"
+#include "utils.hpp"
+
+// Unrolls from the initial states only, which cannot prove safety.
+bool bmc(aiger *aig, std::vector<std::vector<unsigned>> &cex, unsigned bound) {
+  Mcaiger engine(aig, 0);
+  const std::optional<unsigned> k = engine.bmc(bound);
+  if (!k) {
+    L0 << "no counterexample up to bound " << bound << '\n';
+    return false;
+  }
+  L0 << "k: " << *k << '\n';
+  engine.stimulus(*k, cex);
+  return true;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "aiger.hpp"
+
+#include <vector>
+
+bool bmc(aiger *aig, std::vector<std::vector<unsigned>> &cex, unsigned bound);
@@ -6,9 +6,55 @@
 #include "utils.hpp"
 
 #include <algorithm>
+#include <cstdint>
 #include <limits>
+#include <queue>
+#include <span>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 typedef std::vector<unsigned> Cube;
+
+static options *opts;
+// Transition relation without constraints or lemmas, used for --lift. Each
+// forwarding thread uses its own.
+static thread_local CaDiCaL::Solver *lifter;
+// Variables in the sequential cone of influence of bad and the constraints.
+// Gates outside are not encoded and latches outside never occur in cubes.
+static std::vector<bool> cone;
+// Fanout of the model for reducing cubes with ternary simulation.
+static Fanout *fanout;
+
+void influence(aiger *model) {
+  cone.assign(model->maxvar + 1, false);
+  std::vector<unsigned> todo{IDX(output(model))};
+  if (model->num_constraints) todo.push_back(IDX(model->constraints[0].lit));
+  const unsigned lBegin = model->num_inputs + 1;
+  const unsigned aBegin = lBegin + model->num_latches;
+  while (todo.size()) {
+    const unsigned v = todo.back();
+    todo.pop_back();
+    if (cone[v]) continue;
+    cone[v] = true;
+    if (v >= aBegin) {
+      const aiger_and *a = model->ands + (v - aBegin);
+      assert(IDX(a->lhs) == v);
+      todo.push_back(IDX(a->rhs0));
+      todo.push_back(IDX(a->rhs1));
+    } else if (v >= lBegin) {
+      const aiger_symbol *l = model->latches + (v - lBegin);
+      todo.push_back(IDX(l->next));
+      if (l->reset > 1 && l->reset != l->lit) todo.push_back(IDX(l->reset));
+    }
+  }
+  L2 << "cone of influence"
+     << std::count(cone.begin() + lBegin, cone.begin() + aBegin, true) << "of"
+     << model->num_latches << "latches"
+     << std::count(cone.begin() + aBegin, cone.end(), true) << "of"
+     << model->num_ands << "ands";
+}
+
 void gate(CaDiCaL::Solver *frame, int a, int x, int y) {
   assert(a);
   frame->add(-SAT(a));
@@ -26,11 +72,14 @@ void gate(CaDiCaL::Solver *frame, int a, int x, int y) {
 void gates(aiger *model, CaDiCaL::Solver *frame) {
   for (size_t i = 0; i < model->num_ands; ++i) {
     aiger_and *a = model->ands + i;
+    if (!cone[IDX(a->lhs)]) continue;
     gate(frame, a->lhs, a->rhs0, a->rhs1);
   }
 }
 
-void reset(aiger *model, CaDiCaL::Solver *frame) {
+// A non-zero act guards the reset clauses, such that they only hold while act
+// is assumed.
+void reset(aiger *model, CaDiCaL::Solver *frame, int act = 0) {
   L3 << "enforcing reset in" << frame;
   for (size_t i = 0; i < model->num_latches; ++i) {
     const aiger_symbol *latch = model->latches + i;
@@ -41,16 +90,20 @@ void reset(aiger *model, CaDiCaL::Solver *frame) {
     assert(gate ^ 1u);
     assert(lit);
     if (reset == 0) {
+      if (act) frame->add(-act);
       frame->add(-lit);
       frame->add(0);
     } else if (reset == 1) {
+      if (act) frame->add(-act);
       frame->add(lit);
       frame->add(0);
     } else {
       const int rLit = SAT(reset);
+      if (act) frame->add(-act);
       frame->add(-rLit);
       frame->add(lit);
       frame->add(0);
+      if (act) frame->add(-act);
       frame->add(rLit);
       frame->add(-lit);
       frame->add(0);
@@ -58,18 +111,40 @@ void reset(aiger *model, CaDiCaL::Solver *frame) {
   }
 }
 
+// A fresh variable of the solver, used as activation literal.
+int fresh(CaDiCaL::Solver *solver) {
+  const int v = solver->vars() + 1;
+  solver->reserve(v);
+  return v;
+}
+
 void initialize(aiger *model, CaDiCaL::Solver *frame) {
+  // Activation literals follow the model variables.
+  frame->reserve(model->maxvar + 1);
   frame->add(SAT(1));
   frame->add(0);
+  if (model->num_constraints) {
+    frame->add(SAT(model->constraints[0].lit));
+    frame->add(0);
+  }
   gates(model, frame);
 }
 
+CaDiCaL::Solver *lifting(aiger *model) {
+  CaDiCaL::Solver *solver = new CaDiCaL::Solver();
+  solver->add(SAT(1));
+  solver->add(0);
+  gates(model, solver);
+  return solver;
+}
+
 Cube cube(aiger *model, CaDiCaL::Solver *frame) {
   // TODO minimize via ternary
   Cube cube;
   for (unsigned i = 0; i < model->num_latches; ++i) {
     const aiger_symbol *latch = model->latches + i;
     const unsigned gate = latch->lit;
+    if (!cone[IDX(gate)]) continue;
     const int lit = SAT(gate);
     const int val = frame->val(lit);
     assert(gate ^ 1u);
@@ -81,7 +156,6 @@ Cube cube(aiger *model, CaDiCaL::Solver *frame) {
 }
 
 Cube inputCube(aiger *model, CaDiCaL::Solver *frame) {
-  // TODO minimize via ternary
   Cube cube;
   for (unsigned i = 0; i < model->num_inputs; ++i) {
     const aiger_symbol *input = model->inputs + i;
@@ -96,37 +170,230 @@ Cube inputCube(aiger *model, CaDiCaL::Solver *frame) {
   return cube;
 }
 
+// Shrinks the state in the model of frame to the latches that together with
+// the inputs imply all literals in target. The lifting query has to be
+// unsatisfiable, the failed latch assumptions form the cube. The failed input
+// assumptions are stored in inputs if given.
+Cube lift(aiger *model, CaDiCaL::Solver *frame,
+          const std::vector<unsigned> &target, Cube *inputs = nullptr) {
+  assert(lifter);
+  std::vector<int> values;
+  values.reserve(model->num_inputs);
+  for (unsigned i = 0; i < model->num_inputs; ++i) {
+    values.push_back(frame->val(SAT(model->inputs[i].lit)));
+    lifter->assume(values.back());
+  }
+  std::vector<int> state;
+  state.reserve(model->num_latches);
+  for (unsigned i = 0; i < model->num_latches; ++i) {
+    const unsigned gate = model->latches[i].lit;
+    state.push_back(cone[IDX(gate)] ? frame->val(SAT(gate)) : 0);
+    if (state.back()) lifter->assume(state.back());
+  }
+  for (unsigned l : target)
+    lifter->constrain(SAT(NOT(l)));
+  lifter->constrain(0);
+  [[maybe_unused]] const int res = lifter->solve();
+  assert(res == 20);
+  Cube cube;
+  for (unsigned i = 0; i < model->num_latches; ++i)
+    if (state[i] && lifter->failed(state[i]))
+      cube.push_back(model->latches[i].lit | (state[i] < 0));
+  if (inputs) {
+    inputs->clear();
+    for (unsigned i = 0; i < model->num_inputs; ++i)
+      if (lifter->failed(values[i]))
+        inputs->push_back(model->inputs[i].lit | (values[i] < 0));
+  }
+  return cube;
+}
+
 static const Cube bot{0};
 static const Cube top{1};
 
+bool subsumes(std::span<const unsigned> small, std::span<const unsigned> big) {
+  // TODO use watch list based forward (?) subsumption?
+  auto s = small.begin(), b = big.begin();
+  const auto S = small.end(), B = big.end();
+  while (s != S && b != B)
+    s += (*s == *b++);
+  return s == S;
+}
+
+// Whether the cubes contain complementary literals.
+bool disjoint(std::span<const unsigned> a, std::span<const unsigned> b) {
+  auto i = a.begin(), j = b.begin();
+  while (i != a.end() && j != b.end())
+    if (IDX(*i) < IDX(*j))
+      i++;
+    else if (IDX(*j) < IDX(*i))
+      j++;
+    else if (*i++ != *j++)
+      return true;
+  return false;
+}
+
+uint64_t signature(const Cube &c) {
+  uint64_t sig = 0;
+  for (unsigned l : c)
+    sig |= 1ull << (l & 63);
+  return sig;
+}
+
 // TODO move to header
 class Frame {
 public:
   // TODO clauses should also be added here
-  // TODO optional: add activation literal to be able to identify F_inf cubes
   // TODO reduce derefs
-  // Encoded as size, followed by the literals.
-  // (n, l0, ..., ln), (n', l0', ..., ln')
-  // -n for deleted cubes
+  // Encoded as size, followed by the stamp of its addition, the literal
+  // signature in two words and the literals.
+  // (n, a, s, t, l0, ..., ln), (n', a', s', t', l0', ..., ln')
+  // ~n for deleted cubes, which are only removed by collect.
   // Each cube is also blocked in all previous frames.
-  std::vector<Cube> cubes;
+  std::vector<unsigned> cubes;
+  static constexpr unsigned HEADER = 4;
+  unsigned count = 0;
+  size_t garbage = 0;
+  // Offsets of all cubes, including deleted ones, in the order they were
+  // pushed. Stamps only grow, so this is also ordered by added.
+  std::vector<unsigned> offsets;
+  // Offsets of the cubes each literal occurs in, may include deleted cubes.
+  // Only sized up to the largest literal pushed so far.
+  std::vector<std::vector<unsigned>> occurs;
+  // Stamps of the last clause added to the frame and of the last forwarding.
+  unsigned strengthened = 0, forwarded = 0;
+  // Cubes that could not be forwarded by offset, with the stamp of the check
+  // and the predecessor that prevented it.
+  std::unordered_map<unsigned, std::pair<unsigned, Cube>> stuck;
   unsigned B, C = 1;
   CaDiCaL::Solver *solver;
-  Frame(aiger *model) {
+  // The lemma clauses in the solver are guarded by act. With --single all
+  // frames share one solver and act identifies the lemmas of this frame.
+  // Otherwise the frame owns its solver, which holds the lemmas of all later
+  // frames.
+  int act;
+  bool owner = false;
+  // Lemma clauses added under act, including the ones of erased cubes.
+  size_t clauses = 0;
+  Frame(aiger *model) : owner(true) {
     assert(model);
     solver = new CaDiCaL::Solver();
     // TODO only on demand
     B = output(model);
     LV5(B);
-    if (model->num_constraints) {
-      C = model->constraints[0].lit;
-      solver->add(SAT(C));
-      solver->add(0);
-    }
+    if (model->num_constraints) C = model->constraints[0].lit;
     initialize(model, solver);
+    act = fresh(solver);
+  }
+  Frame(aiger *model, CaDiCaL::Solver *shared, int act)
+      : solver(shared), act(act) {
+    assert(model && shared && act);
+    B = output(model);
+    if (model->num_constraints) C = model->constraints[0].lit;
+  }
+  bool empty() const { return !count; }
+  bool deleted(unsigned o) const { return cubes[o] >> 31; }
+  unsigned following(unsigned o) const {
+    return o + HEADER + (deleted(o) ? ~cubes[o] : cubes[o]);
+  }
+  std::span<const unsigned> cube(unsigned o) const {
+    assert(!deleted(o));
+    return {cubes.data() + o + HEADER, cubes[o]};
+  }
+  unsigned added(unsigned o) const { return cubes[o + 1]; }
+  uint64_t signature(unsigned o) const {
+    return cubes[o + 2] | (uint64_t)cubes[o + 3] << 32;
+  }
+  // Calls f with the literals of each cube that is not deleted.
+  template <typename F> void each(F f) const {
+    for (unsigned o = 0; o < cubes.size(); o = following(o))
+      if (!deleted(o)) f(cube(o));
+  }
+  void push(const Cube &c, unsigned stamp) {
+    const unsigned o = cubes.size();
+    assert(offsets.empty() || added(offsets.back()) <= stamp);
+    offsets.push_back(o);
+    if (c.size() && occurs.size() <= c.back()) occurs.resize(c.back() + 1);
+    for (unsigned l : c)
+      occurs[l].push_back(o);
+    const uint64_t sig = ::signature(c);
+    cubes.push_back(c.size());
+    cubes.push_back(stamp);
+    cubes.push_back(sig);
+    cubes.push_back(sig >> 32);
+    cubes.insert(cubes.end(), c.begin(), c.end());
+    count++;
+  }
+  void erase(unsigned o) {
+    assert(!deleted(o));
+    garbage += HEADER + cubes[o];
+    cubes[o] = ~cubes[o];
+    count--;
+  }
+  // Compacts the cubes once at least half of the arena is deleted, which
+  // invalidates all offsets.
+  void collect() {
+    if (2 * garbage < cubes.size()) return;
+    L3 << "collecting" << garbage << "of" << cubes.size();
+    std::vector<unsigned> compacted;
+    compacted.reserve(cubes.size() - garbage);
+    std::unordered_map<unsigned, std::pair<unsigned, Cube>> moved;
+    for (auto &o : occurs)
+      o.clear();
+    offsets.clear();
+    for (unsigned o = 0; o < cubes.size(); o = following(o)) {
+      if (deleted(o)) continue;
+      offsets.push_back(compacted.size());
+      for (unsigned l : cube(o))
+        occurs[l].push_back(compacted.size());
+      if (auto s = stuck.find(o); s != stuck.end())
+        moved.emplace(compacted.size(), std::move(s->second));
+      compacted.insert(compacted.end(), cubes.begin() + o,
+                       cubes.begin() + following(o));
+    }
+    cubes = std::move(compacted);
+    stuck = std::move(moved);
+    garbage = 0;
+  }
+  // Offsets of the cubes subsumed by c. Only the cubes in the shortest
+  // occurrence list of the literals in c are candidates.
+  std::vector<unsigned> subsumed(const Cube &c) const {
+    const uint64_t sig = ::signature(c);
+    std::vector<unsigned> res;
+    auto check = [&](unsigned o) {
+      if (!deleted(o) && !(sig & ~signature(o)) && subsumes(c, cube(o)))
+        res.push_back(o);
+    };
+    const std::vector<unsigned> *candidates{};
+    for (unsigned l : c) {
+      if (l >= occurs.size()) return res;
+      if (!candidates || occurs[l].size() < candidates->size())
+        candidates = &occurs[l];
+    }
+    if (candidates)
+      for (unsigned o : *candidates)
+        check(o);
+    else
+      for (unsigned o = 0; o < cubes.size(); o = following(o))
+        check(o);
+    return res;
+  }
+  // Whether a cube subsumes c, which is then blocked by the frame.
+  bool blocks(const Cube &c) const {
+    const uint64_t sig = ::signature(c);
+    for (unsigned l : c) {
+      if (l >= occurs.size()) continue;
+      // Each cube is only checked for its first literal.
+      for (unsigned o : occurs[l])
+        if (!deleted(o) && cube(o)[0] == l && !(signature(o) & ~sig) &&
+            subsumes(cube(o), c))
+          return true;
+    }
+    return false;
   }
   bool intersects(const Cube &c) {
     // TODO do I need to minimize here?
+    solver->assume(act);
     for (unsigned g : c)
       solver->assume(SAT(g));
     const bool res{solver->solve() == 10};
@@ -134,39 +401,222 @@ public:
   }
 };
 
-bool subsumes(const Cube &small, const Cube &big) {
-  // TODO use watch list based forward (?) subsumption?
-  auto s = small.begin(), b = big.begin();
-  const auto S = small.end(), B = big.end();
-  while (s != S && b != B)
-    s += (*s == *b++);
-  return s == S;
+// Whether c intersects the initial states of frame 0. Without constraints and
+// reset functions this only depends on the constant resets, otherwise it needs
+// a SAT call unless c contradicts a constant reset.
+bool initial(aiger *model, Frame &f0, const Cube &c) {
+  bool syntactic = !model->num_constraints;
+  for (unsigned l : c) {
+    assert(is_latch(model, l));
+    const unsigned r = model->latches[IDX(l) - model->num_inputs - 1].reset;
+    if (r < 2) {
+      if (r == SGN(l)) return false;
+    } else if (r != ABS(l))
+      syntactic = false;
+  }
+  return syntactic || f0.intersects(c);
+}
+
+// A state that reaches bad in depth steps and has to be blocked at frame.
+// Inputs lead from cube to the successor obligation next, or to bad.
+struct Obligation {
+  Cube cube, inputs;
+  unsigned frame, depth, next;
+};
+
+// Adds the clause blocking c, guarded by act if non-zero.
+void clause(CaDiCaL::Solver *solver, int act, std::span<const unsigned> c) {
+  if (act) solver->add(-act);
+  for (unsigned g : c)
+    solver->add(SAT(NOT(g)));
+  solver->add(0);
+}
+
+// Lemmas inductive relative to themselves, in all solvers and never forwarded.
+static Frame *infinite;
+
+// Appends a frame, in the shared solver it is identified by a fresh
+// activation literal.
+void append(aiger *model, std::vector<Frame> &frames,
+            CaDiCaL::Solver *shared) {
+  L2 << "appending frame" << frames.size();
+  if (!shared) {
+    frames.emplace_back(model);
+    infinite->each([&](auto c) { clause(frames.back().solver, 0, c); });
+    return;
+  }
+  frames.emplace_back(model, shared, fresh(shared));
+}
+
+// Assume the lemmas of frame k, which are the ones of all later frames.
+// Frame 0 only consists of the initial states.
+void activate(std::vector<Frame> &frames, unsigned k) {
+  if (!k || frames[k].owner) {
+    frames[k].solver->assume(frames[k].act);
+    return;
+  }
+  for (unsigned j = k; j < frames.size(); ++j)
+    frames[j].solver->assume(frames[j].act);
+}
+
+// Stamps are increased with every added clause.
+static unsigned stamp;
+
+// Disables all clauses under the activation literal of f, which the solver
+// then removes as satisfied.
+void retire(Frame &f) {
+  f.solver->add(-f.act);
+  f.solver->add(0);
+  f.act = fresh(f.solver);
+  f.clauses = 0;
+}
+
+// Add the clause blocking c to the frames from..to. In the shared solver the
+// clause is only added once, guarded by the activation literal of frame to.
+void block(std::vector<Frame> &frames, const Cube &c, unsigned from,
+           unsigned to) {
+  assert(from && from <= to && to < frames.size());
+  ++stamp;
+  for (unsigned j = from; j <= to; ++j)
+    frames[j].strengthened = stamp;
+  if (!frames[to].owner) from = to;
+  for (unsigned j = from; j <= to; ++j) {
+    clause(frames[j].solver, frames[j].act, c);
+    frames[j].clauses++;
+  }
+}
+
+// Once more than half of the lemma clauses of frame k belong to erased cubes,
+// they are retired and the remaining cubes are added again.
+void refresh(std::vector<Frame> &frames, unsigned k) {
+  Frame &f = frames[k];
+  const unsigned to = f.owner ? frames.size() - 1 : k;
+  size_t live = 0;
+  for (unsigned j = k; j <= to; ++j)
+    live += frames[j].count;
+  if (f.clauses <= 2 * live) return;
+  L3 << "retiring" << f.clauses - live << "of" << f.clauses << "lemmas at"
+     << k;
+  retire(f);
+  for (unsigned j = k; j <= to; ++j)
+    frames[j].each([&f](auto c) {
+      clause(f.solver, f.act, c);
+      f.clauses++;
+    });
+}
+
+// Copy of the frames for one forwarding thread. As with --single all frames
+// share one solver, which holds the cubes added up to stamp synced. Clauses
+// of erased cubes are retired like in the frames.
+struct Worker {
+  CaDiCaL::Solver *solver, *lifter{};
+  std::vector<Frame> frames;
+  unsigned synced = 0;
+};
+static std::vector<Worker> workers;
+
+void sync(aiger *model, const std::vector<Frame> &frames) {
+  if (workers.empty()) {
+    workers.resize(opts->threads);
+    for (Worker &w : workers) {
+      w.solver = new CaDiCaL::Solver();
+      initialize(model, w.solver);
+      if (opts->lift) w.lifter = lifting(model);
+    }
+  }
+  for (Worker &w : workers) {
+    while (w.frames.size() < frames.size()) {
+      w.frames.emplace_back(model, w.solver, fresh(w.solver));
+      if (w.frames.size() == 1) reset(model, w.solver, w.frames[0].act);
+    }
+    const Frame &inf = *infinite;
+    for (unsigned o = 0; o < inf.cubes.size(); o = inf.following(o))
+      if (!inf.deleted(o) && inf.added(o) > w.synced)
+        clause(w.solver, 0, inf.cube(o));
+    for (unsigned j = 1; j < frames.size(); ++j) {
+      const Frame &f = frames[j];
+      Frame &m = w.frames[j];
+      if (f.strengthened <= w.synced) continue;
+      const bool all = m.clauses > 2 * f.count;
+      if (all) retire(m);
+      for (unsigned o = 0; o < f.cubes.size(); o = f.following(o))
+        if (!f.deleted(o) && (all || f.added(o) > w.synced)) {
+          clause(w.solver, m.act, f.cube(o));
+          m.clauses++;
+        }
+    }
+    w.synced = stamp;
+  }
+}
+
+void release(std::vector<Frame> &frames) {
+  // TODO move this to uniqueptr
+  if (!frames[0].owner)
+    delete frames[0].solver;
+  else
+    for (auto &f : frames)
+      delete f.solver;
+  delete lifter;
+  lifter = nullptr;
+  delete fanout;
+  fanout = nullptr;
+  if (infinite->owner) delete infinite->solver;
+  delete infinite;
+  infinite = nullptr;
+  for (Worker &w : workers) {
+    delete w.solver;
+    delete w.lifter;
+  }
+  workers.clear();
+}
+
+// Activity of the latches, bumped for the literals of lemmas and of failed
+// assumptions in generalization. Later bumps weigh more.
+static std::vector<double> activity;
+static double increment;
+
+void bump(const Cube &c) {
+  for (unsigned l : c)
+    if ((activity[IDX(l)] += increment) > 1e100) {
+      for (double &a : activity)
+        a *= 1e-100;
+      increment *= 1e-100;
+    }
 }
 
 void addBlockedCube(std::vector<Frame> &frames, const Cube c, unsigned k) {
   assert(k < frames.size());
   L3 << "adding to" << k << c;
   for (unsigned d = 1; d <= k; ++d) {
-    std::vector<Cube> &cubes = frames[d].cubes;
-    for (unsigned i = 0; i < cubes.size();) {
-      if (subsumes(c, cubes[i])) {
-        L3 << "subsumes at" << d << cubes[i];
-        cubes[i] = std::move(cubes.back());
-        cubes.pop_back();
-      } else
-        i++;
+    Frame &f = frames[d];
+    for (unsigned o : f.subsumed(c)) {
+      L3 << "subsumes at" << d << Cube(f.cube(o).begin(), f.cube(o).end());
+      f.erase(o);
     }
   }
-  frames[k].cubes.push_back(c);
+  frames[k].push(c, stamp);
+  bump(c);
+  increment /= 0.95;
 }
 
-Cube bad(aiger *model, Frame &f, bool minimize = true) {
+// A bad state in the last frame, outside of the cubes blocked under the
+// activation literal outside if non-zero. The inputs reaching bad from it are
+// stored in inputs if given, reduced along with the state.
+Cube bad(aiger *model, std::vector<Frame> &frames, bool minimize = true,
+         int outside = 0, Cube *inputs = nullptr) {
+  Frame &f = frames.back();
   L3 << "searching for bad, assuming" << SAT(f.B);
+  activate(frames, frames.size() - 1);
+  if (outside) f.solver->assume(outside);
   f.solver->assume(SAT(f.B));
   const int res = f.solver->solve();
   if (res == 20) return bot;
   assert(res == 10);
-  if (!minimize) return cube(model, f.solver);
+  if (!minimize) {
+    if (inputs) *inputs = inputCube(model, f.solver);
+    return cube(model, f.solver);
+  }
+  if (opts->lift) return lift(model, f.solver, {f.B, f.C}, inputs);
   L5 << "found bad" << cube(model, f.solver);
   std::vector<ternary> s(model->maxvar + 1);
   assert(aiger_is_reencoded(model));
@@ -178,7 +628,8 @@ Cube bad(aiger *model, Frame &f, bool minimize = true) {
   assert(s[IDX(f.B)] == STX(f.B));
 #endif
 
-  Cube b = reduce(model, {f.B, f.C}, s);
+  Cube b = reduce(model, *fanout, {f.B, f.C}, s);
+  if (inputs) *inputs = reduceInputs(model, *fanout, {f.B, f.C}, s);
 
   L3 << "return" << b;
 #ifndef NDEBUG
@@ -189,8 +640,13 @@ Cube bad(aiger *model, Frame &f, bool minimize = true) {
   return b;
 }
 
+// A predecessor in frame k of the cube b, which is shrunk to the failed
+// literals if there is none. The inputs leading to b are stored in inputs if
+// given, reduced along with the predecessor if minA.
 template <bool constrain = true>
-Cube predecessor(aiger *model, Frame &f, Cube &b, Frame &f0, bool minA = true) {
+Cube predecessor(aiger *model, std::vector<Frame> &frames, unsigned k, Cube &b,
+                 bool minA = true, Cube *inputs = nullptr) {
+  Frame &f = frames[k], &f0 = frames[0];
   // TODO if cadical only reconstructs the model on val, it might be benefical
   // to split the return of a from the SAT query.
   std::vector<unsigned> bNext;
@@ -216,6 +672,7 @@ Cube predecessor(aiger *model, Frame &f, Cube &b, Frame &f0, bool minA = true) {
     if (constrain) f.solver->constrain(SAT(NOT(g)));
   }
   if (constrain && b.size()) f.solver->constrain(0);
+  activate(frames, k);
   assert(bNext.size() <= model->num_latches + 1);
   const int res = f.solver->solve();
   if (res == 20) {
@@ -239,13 +696,17 @@ Cube predecessor(aiger *model, Frame &f, Cube &b, Frame &f0, bool minA = true) {
             b.end());
 
     // TODO be a bit more conservative here
-    if (f0.intersects(b)) b = std::move(save);
+    if (initial(model, f0, b)) b = std::move(save);
     L3 << "shrunk b to" << b;
     return bot;
   }
   assert(res == 10);
   L3 << "found predecessor" << cube(model, f.solver) << "of" << b;
-  if (!minA) return cube(model, f.solver);
+  if (!minA) {
+    if (inputs) *inputs = inputCube(model, f.solver);
+    return cube(model, f.solver);
+  }
+  if (opts->lift) return lift(model, f.solver, bNext, inputs);
   // TODO use global ternary state
 
   std::vector<ternary> s(model->maxvar + 1);
@@ -264,7 +725,8 @@ Cube predecessor(aiger *model, Frame &f, Cube &b, Frame &f0, bool minA = true) {
                      [&s](auto l) { return s[IDX(l)] == STX(l); }));
 #endif
   // her
-  Cube a = reduce(model, bNext, s);
+  Cube a = reduce(model, *fanout, bNext, s);
+  if (inputs) *inputs = reduceInputs(model, *fanout, bNext, s);
   L3 << "return" << a;
 #ifndef NDEBUG
   const Cube fullB = cube(model, f.solver);
@@ -274,159 +736,475 @@ Cube predecessor(aiger *model, Frame &f, Cube &b, Frame &f0, bool minA = true) {
   return a;
 }
 
-void generalize(aiger *model, Frame &f, Frame &f0, std::vector<unsigned> &b) {
-  L3 << "generalizing" << b;
-  std::vector<unsigned> c{b};
-  unsigned d = std::numeric_limits<unsigned>::max();
-  bool covered = true;
-  for (int i = c.size(); i--;) {
-    if (covered) {
-      i = std::min((size_t)i, c.size() - 1);
-      while (c[i] > d)
-        if (!i--) break;
-      if (i < 0) return;
-      d = c[i];
-      c.erase(c.begin() + i);
-    } else {
-      assert(c[i] < d);
-      std::swap(d, c[i]);
+void generalize(aiger *model, std::vector<Frame> &frames, unsigned k,
+                std::vector<unsigned> &b, unsigned depth = 0);
+
+// Blocks the state s in frame k as far as possible, if it is not initial and
+// inductive relative to frame k - 1.
+bool counter(aiger *model, std::vector<Frame> &frames, unsigned k, Cube &s,
+             unsigned depth) {
+  assert(k);
+  if (initial(model, frames[0], s)) return false;
+  if (bot != predecessor(model, frames, k - 1, s, false)) return false;
+  unsigned j = k;
+  while (j + 1 < frames.size()) {
+    Cube t = s;
+    if (bot != predecessor(model, frames, j, t, false)) break;
+    s = std::move(t);
+    j++;
+  }
+  if (j > 1) generalize(model, frames, j - 1, s, depth + 1);
+  block(frames, s, 1, j);
+  addBlockedCube(frames, s, j);
+  return true;
+}
+
+// Checks whether c is inductive relative to frame k. A counterexample to
+// generalization (CTG) that is itself inductive relative to frame k - 1 is
+// blocked as far as possible and the check is repeated.
+bool down(aiger *model, std::vector<Frame> &frames, unsigned k, Cube &c,
+          unsigned depth) {
+  unsigned ctgs = 0;
+  while (true) {
+    const bool ctg = k && depth < opts->ctg_depth && ctgs < opts->ctg;
+    Cube s = predecessor(model, frames, k, c, ctg);
+    if (s == bot) {
+      bump(c);
+      return true;
     }
-    // TODO another expensive reset intersection
-    if ((covered = (!f0.intersects(c) &&
-                    bot == predecessor(model, f, c, f0, false)))) {
+    if (!ctg || !counter(model, frames, k, s, depth)) return false;
+    L3 << "blocked CTG" << s << "for" << c;
+    ctgs++;
+  }
+}
+
+// Tries to drop the literals of b with the lowest activity first, ties are
+// broken by dropping larger literals first.
+void generalize(aiger *model, std::vector<Frame> &frames, unsigned k,
+                std::vector<unsigned> &b, unsigned depth) {
+  Frame &f0 = frames[0];
+  L3 << "generalizing" << b;
+  std::vector<unsigned> order(b.rbegin(), b.rend());
+  std::stable_sort(order.begin(), order.end(), [](unsigned l, unsigned m) {
+    return activity[IDX(l)] < activity[IDX(m)];
+  });
+  for (unsigned l : order) {
+    auto it = std::lower_bound(b.begin(), b.end(), l);
+    if (it == b.end() || *it != l) continue;
+    std::vector<unsigned> c{b};
+    c.erase(c.begin() + (it - b.begin()));
+    if (!initial(model, f0, c) && down(model, frames, k, c, depth)) {
       L3 << "reduced to" << c;
-      b = c;
+      b = std::move(c);
+    }
+  }
+}
+
+void print(const std::vector<Frame> &frames) {
+  for (unsigned i = 1; i < frames.size(); ++i) {
+    L3 << "frame" << i;
+    frames[i].each([](auto c) { L3 << Cube(c.begin(), c.end()); });
+  }
+}
+
+// Whether a cube added to frame k or above after stamp t intersects a. If not,
+// the states in a that were in frame k at t still are. Only the cubes added
+// after t are visited, from the back of each frame.
+bool intersected(const std::vector<Frame> &frames, unsigned k, unsigned t,
+                 const Cube &a) {
+  for (unsigned j = k; j <= frames.size(); ++j) {
+    const Frame &f = j < frames.size() ? frames[j] : *infinite;
+    if (f.strengthened <= t) continue;
+    for (auto o = f.offsets.rbegin(); o != f.offsets.rend(); ++o) {
+      if (f.added(*o) <= t) break;
+      if (!f.deleted(*o) && !disjoint(a, f.cube(*o))) return true;
     }
   }
+  return false;
+}
+
+// Checks the cubes at offsets todo of frame k on the workers. The cubes are
+// copied to bs, where they are shrunk like by predecessor, which returns as.
+void parallel(aiger *model, std::vector<Frame> &frames, unsigned k,
+              const std::vector<unsigned> &todo, std::vector<Cube> &bs,
+              std::vector<Cube> &as) {
+  sync(model, frames);
+  L3 << "forwarding" << todo.size() << "cubes at" << k << "on"
+     << workers.size() << "threads";
+  bs.resize(todo.size());
+  as.resize(todo.size());
+  for (unsigned i = 0; i < todo.size(); ++i)
+    bs[i].assign(frames[k].cube(todo[i]).begin(),
+                 frames[k].cube(todo[i]).end());
+  std::vector<std::thread> threads;
+  threads.reserve(workers.size());
+  for (unsigned t = 0; t < workers.size(); ++t)
+    threads.emplace_back([&, t] {
+      Worker &w = workers[t];
+      lifter = w.lifter;
+      for (unsigned i = t; i < todo.size(); i += workers.size())
+        as[i] = predecessor<false>(model, w.frames, k, bs[i]);
+    });
+  for (auto &t : threads)
+    t.join();
+}
+
+// Whether c is inductive relative to the infinite frame.
+bool inductive(aiger *model, const Cube &c) {
+  assert(c.size());
+  CaDiCaL::Solver *solver = infinite->solver;
+  for (unsigned g : c) {
+    solver->assume(SAT(next(model, ABS(g)) ^ SGN(g)));
+    solver->constrain(SAT(NOT(g)));
+  }
+  solver->constrain(0);
+  return solver->solve() == 20;
+}
+
+// Moves the cubes of the last frame that are inductive relative to the
+// infinite frame there. Cubes are only checked again once the infinite frame
+// was extended.
+void infinity(aiger *model, std::vector<Frame> &frames) {
+  Frame &f = frames.back();
+  const unsigned checked = infinite->forwarded;
+  const bool all = infinite->strengthened > checked;
+  if (!all && f.strengthened <= checked) return;
+  for (unsigned o = 0; o < f.cubes.size(); o = f.following(o)) {
+    if (f.deleted(o) || (!all && f.added(o) <= checked)) continue;
+    Cube c(f.cube(o).begin(), f.cube(o).end());
+    // Only without initial states all states can be blocked.
+    if (c.empty() || !inductive(model, c)) continue;
+    L3 << "inductive" << c;
+    f.erase(o);
+    if (frames[0].owner)
+      for (unsigned j = 1; j < frames.size(); ++j)
+        clause(frames[j].solver, 0, c);
+    clause(infinite->solver, 0, c);
+    infinite->push(c, ++stamp);
+    infinite->strengthened = stamp;
+  }
+  infinite->forwarded = stamp;
 }
 
 int forwardCubes(aiger *model, std::vector<Frame> &frames) {
   L3 << "forwarding";
+  Cube b;
+  std::vector<unsigned> todo;
+  std::vector<Cube> bs, as;
   for (unsigned k = 1; k < frames.size() - 1; k++) {
-    // TODO use consecutive representation with mark/delete
-    // instead of doing unecessary work by coping here, because addBlocked
-    // modifies
-    auto cubes = frames[k].cubes;
+    Frame &f = frames[k];
+    // Only compacted here, cubes forwarded during the iteration are marked as
+    // deleted but stay in place.
+    f.collect();
+    refresh(frames, k);
     L3 << "testing cubes at" << k;
-    for (auto &c : cubes)
-      L3 << c;
-    for (auto &b : cubes) {
-      L3 << "consider at " << k << b;
-      // TODO shrinking the cube here needs carful consideration
-      Cube a = predecessor<false>(model, frames[k], b, frames[0]);
-      if (a == bot) {
-        for (unsigned g : b)
-          frames[k + 1].solver->add(SAT(NOT(g)));
-        frames[k + 1].solver->add(0);
-        addBlockedCube(frames, b, k + 1);
+    f.each([](auto c) { L3 << Cube(c.begin(), c.end()); });
+    // All remaining cubes failed when the frame was last forwarded.
+    if (f.strengthened > f.forwarded) {
+      // Blocked CTPs can strengthen the frame during the iteration.
+      const unsigned begin = stamp;
+      todo.clear();
+      for (unsigned o = 0; o < f.cubes.size(); o = f.following(o)) {
+        if (f.deleted(o)) continue;
+        auto s = f.stuck.find(o);
+        if (s != f.stuck.end() &&
+            !intersected(frames, k, s->second.first, s->second.second)) {
+          L3 << "still stuck at" << k << "by" << s->second.second;
+          continue;
+        }
+        todo.push_back(o);
+      }
+      // The results of the threads are applied in order of the cubes.
+      as.clear();
+      if (opts->threads > 1 && todo.size() > 1)
+        parallel(model, frames, k, todo, bs, as);
+      for (unsigned i = 0; i < todo.size(); ++i) {
+        const unsigned o = todo[i];
+        if (f.deleted(o)) continue;
+        Cube a;
+        // The stamp of the frames a was computed on. The workers saw them at
+        // begin, before the cubes forwarded earlier in this iteration.
+        unsigned checked = as.empty() ? stamp : begin;
+        if (as.empty()) {
+          b.assign(f.cube(o).begin(), f.cube(o).end());
+          L3 << "consider at " << k << b;
+          // TODO shrinking the cube here needs carful consideration
+          a = predecessor<false>(model, frames, k, b);
+        } else {
+          b = std::move(bs[i]);
+          a = std::move(as[i]);
+        }
+        // A counterexample to propagation (CTP) that is inductive relative to
+        // frame k - 1 is blocked and the cube is tried again.
+        for (unsigned ctps = 0; a != bot && ctps < opts->ctp; ++ctps) {
+          if (!counter(model, frames, k, a, 0)) break;
+          L3 << "blocked CTP" << a << "for" << b;
+          if (f.deleted(o)) break;
+          b.assign(f.cube(o).begin(), f.cube(o).end());
+          a = predecessor<false>(model, frames, k, b);
+          checked = stamp;
+        }
+        if (f.deleted(o)) continue;
+        if (a == bot) {
+          const bool shrunk = b.size() < f.cube(o).size();
+          block(frames, b, k + 1, k + 1);
+          // A shrunk cube also strengthens the frames below.
+          if (shrunk)
+            for (unsigned j = 1; j <= k; ++j)
+              frames[j].strengthened = stamp;
+          addBlockedCube(frames, b, k + 1);
+        } else
+          f.stuck[o] = {checked, std::move(a)};
       }
+      f.forwarded = begin;
     }
-    if (frames[k].cubes.empty()) {
+    if (f.empty()) {
       L3 << "found empty frame" << k;
       // TODO should I continue the propagation?
       // TODO can an other frame be appended to generate smaller invariants?
 
       L3 << "final frames";
-      for (unsigned i = 1; i < frames.size(); ++i) {
-        L3 << "frame" << i;
-        for (auto &c : frames[i].cubes) {
-          L3 << c;
-        }
-      }
-
+      print(frames);
       return k + 1;
     }
   }
+  infinity(model, frames);
   L3 << "Finished forwarding";
-  for (unsigned i = 1; i < frames.size(); ++i) {
-    L3 << "frame" << i;
-    for (auto &c : frames[i].cubes) {
-      L3 << c;
-    }
-  }
+  print(frames);
+  L3 << "infinite frame";
+  infinite->each([](auto c) { L3 << Cube(c.begin(), c.end()); });
 
   return 0;
 }
 
-bool ic3(aiger *model, std::vector<std::vector<unsigned>> &cex) {
+// Shrinks the inductive invariant blocking the lemmas for the certificate.
+// Starting from the lemmas needed to exclude bad, only those in the cores of
+// the relative induction checks of kept lemmas are kept. Then literals are
+// dropped from the kept lemmas while they stay inductive and exclude the
+// initial states, which only strengthens the invariant.
+void minimize(aiger *model, Frame &f0, std::vector<Cube> &lemmas) {
+  CaDiCaL::Solver solver;
+  initialize(model, &solver);
+  std::vector<int> acts;
+  acts.reserve(lemmas.size());
+  for (const Cube &c : lemmas) {
+    acts.push_back(fresh(&solver));
+    clause(&solver, acts.back(), c);
+  }
+  std::vector<bool> needed(lemmas.size());
+  std::vector<unsigned> todo;
+  // Keeps the lemmas whose activation literal failed in the last query.
+  auto core = [&] {
+    for (unsigned i = 0; i < lemmas.size(); ++i)
+      if (!needed[i] && solver.failed(acts[i])) {
+        needed[i] = true;
+        todo.push_back(i);
+      }
+  };
+  for (int act : acts)
+    solver.assume(act);
+  solver.assume(SAT(output(model)));
+  [[maybe_unused]] int res = solver.solve();
+  assert(res == 20);
+  core();
+  while (todo.size()) {
+    const unsigned i = todo.back();
+    todo.pop_back();
+    for (int act : acts)
+      solver.assume(act);
+    for (unsigned g : lemmas[i])
+      solver.assume(SAT(next(model, ABS(g)) ^ SGN(g)));
+    res = solver.solve();
+    assert(res == 20);
+    core();
+  }
+  for (unsigned i = 0; i < lemmas.size(); ++i) {
+    if (!needed[i]) continue;
+    Cube &c = lemmas[i];
+    for (unsigned j = 0; j < c.size() && c.size() > 1;) {
+      Cube d = c;
+      d.erase(d.begin() + j);
+      if (initial(model, f0, d)) {
+        ++j;
+        continue;
+      }
+      const int act = fresh(&solver);
+      clause(&solver, act, d);
+      solver.assume(act);
+      for (unsigned k = 0; k < lemmas.size(); ++k)
+        if (needed[k]) solver.assume(acts[k]);
+      for (unsigned g : d)
+        solver.assume(SAT(next(model, ABS(g)) ^ SGN(g)));
+      if (solver.solve() == 20) {
+        L3 << "strengthened" << c << "to" << d;
+        solver.add(-acts[i]);
+        solver.add(0);
+        acts[i] = act;
+        c = std::move(d);
+      } else {
+        solver.add(-act);
+        solver.add(0);
+        ++j;
+      }
+    }
+  }
+  const size_t before = lemmas.size();
+  unsigned kept = 0;
+  for (unsigned i = 0; i < lemmas.size(); ++i) {
+    if (!needed[i]) continue;
+    if (kept != i) lemmas[kept] = std::move(lemmas[i]);
+    kept++;
+  }
+  lemmas.resize(kept);
+  L2 << "minimized invariant from" << before << "to" << kept << "lemmas";
+}
+
+bool ic3(aiger *model, std::vector<std::vector<unsigned>> &cex,
+         options *options) {
+  opts = options;
   if (model->num_constraints > 1) {
     unsigned C = conj(model, constraints(model) | lits);
     model->constraints[0].lit = C;
     model->num_constraints = 1;
   }
+  influence(model);
+  activity.assign(model->maxvar + 1, 0);
+  increment = 1;
+  CaDiCaL::Solver *shared{};
+  if (opts->single) {
+    shared = new CaDiCaL::Solver();
+    initialize(model, shared);
+  }
+  if (opts->lift)
+    lifter = lifting(model);
+  else
+    fanout = new Fanout(model);
+  if (shared)
+    infinite = new Frame(model, shared, fresh(shared));
+  else
+    infinite = new Frame(model);
   std::vector<Frame> frames;
-  L2 << "appending frame" << frames.size();
-  frames.emplace_back(model);
-  reset(model, frames[0].solver);
+  std::vector<Obligation> obligations;
+  // Lowest frame first, ties are broken by the distance to bad.
+  auto later = [&obligations](unsigned i, unsigned j) {
+    const Obligation &a = obligations[i], &b = obligations[j];
+    return std::tie(a.frame, a.depth) > std::tie(b.frame, b.depth);
+  };
+  std::priority_queue<unsigned, std::vector<unsigned>, decltype(later)> queue(
+      later);
+  append(model, frames, shared);
+  reset(model, frames[0].solver, frames[0].act);
   while (true) {
-    Cube b = bad(model, frames.back(), frames.size() > 1);
+    Cube inputs;
+    Cube b = bad(model, frames, frames.size() > 1, 0, &inputs);
     if (b == bot) {
       const int converged = forwardCubes(model, frames);
       if (converged) {
         L3 << "Proven safety at" << frames.size() - 1;
         // cubes.insert(cubes.end(), frames.rbegin()[1].cubes.begin(),
         // frames.rbegin()[1].cubes.end());
-        unsigned badCubes = 0;
+        unsigned badCubes = infinite->count;
         for (unsigned i = converged; i < frames.size(); ++i)
-          badCubes += frames[i].cubes.size();
-        std::vector<unsigned> bs;
-        bs.reserve(badCubes);
+          badCubes += frames[i].count;
+        std::vector<Cube> lemmas;
+        lemmas.reserve(badCubes);
+        auto collect = [&](auto c) { lemmas.emplace_back(c.begin(), c.end()); };
+        infinite->each(collect);
         for (unsigned i = converged; i < frames.size(); ++i)
-          for (auto &c : frames[i].cubes)
-            bs.push_back(conj(model, c));
+          frames[i].each(collect);
+        if (opts->certificate && opts->minimize)
+          minimize(model, frames[0], lemmas);
+        std::vector<unsigned> bs;
+        bs.reserve(lemmas.size());
+        for (const Cube &c : lemmas)
+          bs.push_back(conj(model, c));
         if (model->num_bad)
           model->bad->lit = disj(model, bs);
         else if (model->num_outputs)
           model->outputs->lit = disj(model, bs);
         else
           aiger_add_output(model, disj(model, bs), "");
-        // TODO move this to uniqueptr
-        for (auto &f : frames)
-          delete f.solver;
+        release(frames);
         return false;
       }
-      L2 << "appending frame" << frames.size();
-      frames.emplace_back(model);
+      append(model, frames, shared);
       continue;
     }
-    std::vector<Cube> obligations{b},
-        inputs{inputCube(model, frames.back().solver)};
+    obligations.clear();
+    obligations.push_back(
+        {b, std::move(inputs), (unsigned)frames.size() - 1, 0, INV});
+    queue.push(0);
     L3 << "found bad" << b << "at frame" << frames.size() - 1;
-    while (obligations.size()) {
-      const size_t k = frames.size() - obligations.size();
+    // Further bad states outside of the cubes found so far are handled in
+    // the same batch of obligations.
+    if (frames.size() > 1 && opts->bads > 1) {
+      CaDiCaL::Solver *solver = frames.back().solver;
+      const int outside = fresh(solver);
+      while (obligations.size() < opts->bads) {
+        clause(solver, outside, obligations.back().cube);
+        Cube c = bad(model, frames, true, outside, &inputs);
+        if (c == bot) break;
+        L3 << "found bad" << c << "at frame" << frames.size() - 1;
+        obligations.push_back({std::move(c), std::move(inputs),
+                               (unsigned)frames.size() - 1, 0, INV});
+        queue.push(obligations.size() - 1);
+      }
+      solver->add(-outside);
+      solver->add(0);
+    }
+    while (queue.size()) {
+      const unsigned o = queue.top();
+      queue.pop();
+      const unsigned k = obligations[o].frame;
       if (!k) {
         L3 << "found CEX";
-        cex.reserve(inputs.size() + 1);
-        cex.emplace_back(std::move(obligations.back()));
-        for (int i = inputs.size(); i--;)
-          cex.emplace_back(std::move(inputs[i]));
-        for (auto &f : frames)
-          delete f.solver;
+        cex.reserve(obligations[o].depth + 2);
+        cex.emplace_back(std::move(obligations[o].cube));
+        for (unsigned i = o; i != INV; i = obligations[i].next)
+          cex.emplace_back(std::move(obligations[i].inputs));
+        release(frames);
         return true;
       }
-      Cube &b = obligations.back();
-      // TODO (isBlocked(b)) obligations.pop(), continue;
+      // predecessor and generalize shrink the cube, the obligation keeps the
+      // state for re-enqueueing
+      Cube b = obligations[o].cube;
+      if (infinite->blocks(b)) {
+        L3 << "already blocked" << b << "in all frames";
+        continue;
+      }
+      unsigned j = frames.size() - 1;
+      while (j >= k && !frames[j].blocks(b))
+        j--;
+      if (j >= k) {
+        L3 << "already blocked" << b << "up to" << j;
+        if (j + 1 < frames.size()) {
+          obligations[o].frame = j + 1;
+          queue.push(o);
+        }
+        continue;
+      }
       L3 << "checking for predecessor of" << b << "in" << k - 1;
-      assert(k > 0);
-      Cube a = predecessor(model, frames[k - 1], b, frames[0], k > 1);
+      Cube inputs;
+      Cube a = predecessor(model, frames, k - 1, b, k > 1, &inputs);
       if (a == bot) {
-        if (k > 1) generalize(model, frames[k - 1], frames[0], b);
+        if (k > 1) generalize(model, frames, k - 1, b);
         L3 << "block cube" << b << "in" << k;
         // TODO should we do subsumption over all Frames here?
         // TODO should I really add weaker clauses to previous frames?
-        for (unsigned j = 1; j <= k; ++j) {
-          for (unsigned g : b)
-            frames[j].solver->add(SAT(NOT(g)));
-          frames[j].solver->add(0);
-        }
+        block(frames, b, 1, k);
         addBlockedCube(frames, b, k);
-        obligations.pop_back();
-        if (inputs.size()) // last obligation popped so no input
-          inputs.pop_back();
+        if (k + 1 < frames.size()) {
+          L3 << "re-enqueue obligation at" << k + 1;
+          obligations[o].frame++;
+          queue.push(o);
+        }
       } else {
         L3 << "adding obligation" << a << "to" << k - 1;
-        obligations.push_back(std::move(a));
-        inputs.push_back(inputCube(model, frames[k - 1].solver));
+        const unsigned depth = obligations[o].depth + 1;
+        obligations.push_back(
+            {std::move(a), std::move(inputs), k - 1, depth, o});
+        queue.push(obligations.size() - 1);
+        queue.push(o);
       }
     }
   }
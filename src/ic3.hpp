@@ -1,7 +1,9 @@
 #pragma once
 
 #include "aiger.hpp"
+#include "options.hpp"
 
 #include <vector>
 
-bool ic3(aiger *model, std::vector<std::vector<unsigned>> &cex);
+bool ic3(aiger *model, std::vector<std::vector<unsigned>> &cex,
+         options *options);
@@ -11,6 +11,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <memory>
+#include <mutex>
+#include <thread>
+
 static aiger *model;
 
 // aigcertify_kind
@@ -124,14 +128,17 @@ unsigned map_to_next(unsigned l) {
   return 0;
 }
 
+// Whether witness supports the model, which rules out constraints and reset
+// functions.
+static bool supported() {
+  if (model->num_constraints) return false;
+  for (auto [l, r] : latches(model) | resets)
+    if (r > 1 && r != l) return false;
+  return true;
+}
+
 static void witness(int kin, aiger *&k_witness_model) {
-  bool not_supported = model->num_constraints;
-  for (auto [l, r] : latches(model) | resets) {
-    if (not_supported) break;
-    if (r < 2 || r == l) continue;
-    not_supported = true;
-  }
-  if (not_supported) {
+  if (!supported()) {
     std::cerr << "Voiraig: Constraints and reset functions not supported with kInd without simple path";
     exit(1);
   }
@@ -898,17 +905,49 @@ void unique_witness(int kin, aiger *&witness) {
 
 bool kind(aiger *aig, aiger *&k_witness_model,
           std::vector<std::vector<unsigned>> &cex, unsigned simple_path,
-          bool always_unique) {
-  auto [bug, k] = mcaiger(aig, simple_path);
-  L0 << "k: " << k << '\n';
+          bool always_unique, bool concurrent, bool portfolio) {
   model = aig;
+  // With portfolio the simple path variants race on separate threads and the
+  // first verdict wins. Without simple path constraints the witness is only
+  // supported for some models.
+  std::vector<unsigned> variants{simple_path};
+  if (portfolio) {
+    variants = {2, 1};
+    if (always_unique || supported()) variants.push_back(0);
+  }
+  std::atomic<bool> stop = false;
+  std::vector<std::unique_ptr<Mcaiger>> engines;
+  for (unsigned v : variants)
+    engines.push_back(std::make_unique<Mcaiger>(aig, v, &stop));
+  std::optional<std::pair<bool, int>> result;
+  unsigned winner = 0;
+  if (engines.size() == 1)
+    result = engines[0]->run(concurrent);
+  else {
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < engines.size(); ++i)
+      threads.emplace_back([&, i] {
+        auto r = engines[i]->run(concurrent);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!r || result) return;
+        result = r;
+        winner = i;
+        stop = true;
+      });
+    for (auto &t : threads)
+      t.join();
+    L1 << "paths" << variants[winner] << "won";
+  }
+  assert(result);
+  auto [bug, k] = *result;
+  L0 << "k: " << k << '\n';
   if (bug)
-    stimulus(k, cex);
-  else if (simple_path || always_unique)
+    engines[winner]->stimulus(k, cex);
+  else if (variants[winner] || always_unique)
     unique_witness(k, k_witness_model);
   else
     witness(k, k_witness_model);
-  mcaiger_free();
 
   return bug;
 }
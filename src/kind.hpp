@@ -6,4 +6,4 @@
 
 bool kind(aiger *aig, aiger *&k_witness_model,
           std::vector<std::vector<unsigned>> &cex, unsigned simple_path,
-          bool always_unique);
+          bool always_unique, bool concurrent, bool portfolio);
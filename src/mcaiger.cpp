@@ -12,15 +12,11 @@
 #include <string.h>
 #include <unistd.h>
 
-CaDiCaL::Solver *s;
-static aiger *model;
-
-// mcaiger
-static int ionly, bonly;
-static int acs, mix;
-static int ncs, dcs, rcs;
-static unsigned *frames, sframes, nframes;
-static unsigned nrcs;
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #define picosat_ado_conflicts(...) (0u)
 #define picosat_disable_ado(...) \
@@ -36,60 +32,130 @@ static unsigned nrcs;
   do {                                      \
   } while (0)
 
-static int frame(int k) {
-  int res;
-  res = k * model->maxvar + 2;
-  if (dcs || rcs || mix) res += (model->num_latches + model->num_inputs) * k * (k - 1) / 2;
-  return res;
+// Distances of the variables from bad and the constraints in transitions,
+// which determine the frames that need them.
+void Mcaiger::influence() {
+  std::vector<unsigned> distance(model->maxvar + 1, UINT_MAX);
+  std::vector<unsigned> roots{IDX(::output(model))};
+  unsigned latches = 0, inputs = 0;
+  for (unsigned i = 0; i < model->num_constraints; i++)
+    roots.push_back(IDX(model->constraints[i].lit));
+  // Simple path constraints compare whole states, so every latch has to be
+  // connected to the previous frame, as without the cone.
+  if (!ncs)
+    for (unsigned i = 0; i < model->num_latches; i++)
+      roots.push_back(IDX(model->latches[i].lit));
+  for (unsigned d = 0; roots.size(); d++) {
+    std::vector<unsigned> nexts;
+    ands.emplace_back();
+    connections.emplace_back();
+    while (roots.size()) {
+      const unsigned v = roots.back();
+      roots.pop_back();
+      if (!v || distance[v] <= d) continue;
+      distance[v] = d;
+      if (aiger_and *a = aiger_is_and(model, 2 * v)) {
+        ands[d].push_back(a - model->ands);
+        roots.push_back(IDX(a->rhs0));
+        roots.push_back(IDX(a->rhs1));
+      } else if (aiger_symbol *l = aiger_is_latch(model, 2 * v)) {
+        connections[d].push_back(l - model->latches);
+        latches++;
+        nexts.push_back(IDX(l->next));
+      } else if (aiger_is_input(model, 2 * v))
+        inputs++;
+    }
+    roots = std::move(nexts);
+  }
+  std::vector<unsigned> todo;
+  for (unsigned i = 0; i < model->num_latches; i++)
+    if (model->latches[i].reset > 1 &&
+        model->latches[i].reset != model->latches[i].lit) {
+      resets.push_back(i);
+      todo.push_back(IDX(model->latches[i].reset));
+    }
+  std::vector<bool> seen(model->maxvar + 1, false);
+  while (todo.size()) {
+    const unsigned v = todo.back();
+    todo.pop_back();
+    if (seen[v]) continue;
+    seen[v] = true;
+    if (aiger_and *a = aiger_is_and(model, 2 * v)) {
+      reset_ands.push_back(a - model->ands);
+      todo.push_back(IDX(a->rhs0));
+      todo.push_back(IDX(a->rhs1));
+    }
+  }
+  L2 << "cone of influence" << latches << "of" << model->num_latches
+     << "latches" << inputs << "of" << model->num_inputs << "inputs,"
+     << ands.size() << "frames deep";
 }
 
-static int lit(unsigned k, unsigned l) {
+// Solver variables are only allocated for the variables that occur in a frame.
+int Mcaiger::lit(unsigned k, unsigned l) {
   int res;
   assert(0 <= l && l <= 2 * model->maxvar + 1);
-  res = (l <= 1) ? 1 : frame(k) + (int)((l - 2) / 2);
+  if (l <= 1)
+    res = 1;
+  else {
+    if (vars.size() <= k) vars.resize(k + 1);
+    if (vars[k].empty()) vars[k].resize(model->maxvar + 1);
+    int &v = vars[k][l / 2];
+    if (!v) v = ++allocated;
+    res = v;
+  }
   if (l & 1) res = -res;
   return res;
 }
 
-static int input(unsigned k, unsigned i) {
+// The value of l in frame k in the last model, 0 if the frame does not use it.
+// Unlike lit this never allocates.
+int Mcaiger::val(unsigned k, unsigned l) {
+  if (l <= 1) return l ? 1 : -1;
+  if (k >= vars.size() || vars[k].empty() || !vars[k][l / 2]) return 0;
+  const int res = s->val(vars[k][l / 2]) > 0 ? 1 : -1;
+  return l & 1 ? -res : res;
+}
+
+int Mcaiger::input(unsigned k, unsigned i) {
   assert(0 <= i && i < model->num_inputs);
   return lit(k, model->inputs[i].lit);
 }
 
-static int latch(unsigned k, unsigned i) {
+int Mcaiger::latch(unsigned k, unsigned i) {
   assert(0 <= i && i < model->num_latches);
   return lit(k, model->latches[i].lit);
 }
 
-static int next(unsigned k, unsigned i) {
+int Mcaiger::next(unsigned k, unsigned i) {
   assert(0 <= i && i < model->num_latches);
   return lit(k, model->latches[i].next);
 }
 
-static int reset(unsigned i) {
+int Mcaiger::reset(unsigned i) {
   assert(0 <= i && i < model->num_latches);
   return model->latches[i].reset;
 }
 
-static int output(unsigned k, unsigned i) {
+int Mcaiger::output(unsigned k, unsigned i) {
   // using output from aiger.hpp can deal with a bit more
   assert(i == 0);
   // assert(0 <= i && i < model->num_outputs);
-  return lit(k, output(model));
+  return lit(k, ::output(model));
 }
 
-static int constraint(unsigned k, unsigned i) {
+int Mcaiger::constraint(unsigned k, unsigned i) {
   assert(0 <= i && i < model->num_constraints);
   return lit(k, model->constraints[i].lit);
 }
 
-static void unary(int a) {
+void Mcaiger::unary(int a) {
   assert(a);
   s->add(a);
   s->add(0);
 }
 
-static void binary(int a, int b) {
+void Mcaiger::binary(int a, int b) {
   assert(a);
   s->add(a);
   assert(b);
@@ -97,7 +163,7 @@ static void binary(int a, int b) {
   s->add(0);
 }
 
-static void ternary(int a, int b, int c) {
+void Mcaiger::ternary(int a, int b, int c) {
   assert(a);
   s->add(a);
   assert(b);
@@ -107,39 +173,38 @@ static void ternary(int a, int b, int c) {
   s->add(0);
 }
 
-static void gate(int lhs, int rhs0, int rhs1) {
+void Mcaiger::gate(int lhs, int rhs0, int rhs1) {
   binary(-lhs, rhs0);
   binary(-lhs, rhs1);
   ternary(lhs, -rhs0, -rhs1);
 }
 
-static void eq(int lhs, int rhs) {
+void Mcaiger::eq(int lhs, int rhs) {
   binary(-lhs, rhs);
   binary(lhs, -rhs);
 }
 
-static void connect(unsigned k) {
-  unsigned i;
-
+// Adds the gates of frame k at distance d from bad and connects its latches
+// at that distance to the previous frame.
+void Mcaiger::layer(unsigned k, unsigned d) {
+  for (unsigned i : ands[d]) {
+    const aiger_and *a = model->ands + i;
+    gate(lit(k, a->lhs), lit(k, a->rhs0), lit(k, a->rhs1));
+  }
   if (!k) return;
-
-  for (i = 0; i < model->num_latches; i++)
+  for (unsigned i : connections[d])
     eq(next(k - 1, i), latch(k, i));
-
-  L3 << k << "connect";
 }
 
-static void encode(unsigned k) {
-  aiger_and *a;
-  aiger_symbol *c;
+// Frame j only needs the gates that reach bad in the remaining k - j
+// transitions, so each earlier frame grows by one layer.
+void Mcaiger::encode(unsigned k) {
   unsigned i;
 
   if (!k) unary(lit(k, 1)); /* true */
 
-  for (i = 0; i < model->num_ands; i++) {
-    a = model->ands + i;
-    gate(lit(k, a->lhs), lit(k, a->rhs0), lit(k, a->rhs1));
-  }
+  for (unsigned j = k >= ands.size() ? k - ands.size() + 1 : 0; j <= k; j++)
+    layer(j, k - j);
 
   for (i = 0; i < model->num_constraints; i++) {
     unary(constraint(k, i));
@@ -159,7 +224,7 @@ static void encode(unsigned k) {
   L3 << k << "encode";
 }
 
-static void ado(unsigned k) {
+void Mcaiger::ado(unsigned k) {
   unsigned i;
   if (model->num_latches > 0) {
     for (i = 0; i < model->num_latches; i++)
@@ -169,37 +234,32 @@ static void ado(unsigned k) {
   L3 << k << "ado";
 }
 
-static int diff(int k, int l, int i, bool input = false) {
-  assert(0 <= i && i < (model->num_latches + model->num_inputs));
-  assert(l < k);
-  return frame(k + 1) - (i + input * model->num_latches) - l * (model->num_latches + model->num_inputs) - 1;
-}
-
-static void diffs(unsigned k, unsigned l) {
-  unsigned i, tmp;
+// The frames k and l differ in a latch or input. This covers all of them, not
+// just the cone, since the witness relies on the same simple path constraints.
+void Mcaiger::diffs(unsigned k, unsigned l) {
+  unsigned i;
   assert(k != l);
-  if (l > k) {
-    tmp = k;
-    k = l;
-    l = tmp;
-  }
+  std::vector<int> ds;
+  ds.reserve(model->num_latches + model->num_inputs);
   for (i = 0; i < model->num_latches; i++) {
-    ternary(latch(l, i), latch(k, i), -diff(k, l, i));
-    ternary(-latch(l, i), -latch(k, i), -diff(k, l, i));
+    ds.push_back(++allocated);
+    ternary(latch(l, i), latch(k, i), -ds.back());
+    ternary(-latch(l, i), -latch(k, i), -ds.back());
   }
   for (i = 0; i < model->num_inputs; i++) {
-    ternary(input(l, i), input(k, i), -diff(k, l, i, true));
-    ternary(-input(l, i), -input(k, i), -diff(k, l, i, true));
+    ds.push_back(++allocated);
+    ternary(input(l, i), input(k, i), -ds.back());
+    ternary(-input(l, i), -input(k, i), -ds.back());
   }
   if (model->num_latches > 0) {
-    for (i = 0; i < (model->num_latches + model->num_inputs); i++)
-      s->add(diff(k, l, i));
+    for (int d : ds)
+      s->add(d);
     s->add(0);
   }
   L3 << "diffs" << l << k;
 }
 
-static void diffsk(unsigned k) {
+void Mcaiger::diffsk(unsigned k) {
   unsigned l;
   if (!k) return;
   for (l = 0; l < k; l++)
@@ -207,7 +267,7 @@ static void diffsk(unsigned k) {
   L3 << k << "diffsk";
 }
 
-static void simple(unsigned k) {
+void Mcaiger::simple(unsigned k) {
   if (dcs)
     diffsk(k);
   else if (acs)
@@ -216,22 +276,39 @@ static void simple(unsigned k) {
     assert(rcs || ncs);
 }
 
-static void bad(unsigned k) {
+void Mcaiger::bad(unsigned k) {
   // using output from aiger.hpp can deal with a bit more
   // assert(model->num_outputs == 1);
   s->assume(output(k, 0));
   L3 << k << "bad";
 }
 
-static void init(unsigned k) {
+// Latches with a reset function equal it in frame 0. Unless the initial
+// states are permanent, these equalities are guarded by the assumed literal
+// resetting, otherwise it is the constant true.
+void Mcaiger::init(unsigned k) {
   unsigned i;
   int l, r;
 
   if (bonly && k) return;
 
+  if (!resetting && resets.size()) {
+    resetting = bonly ? lit(0, 1) : ++allocated;
+    for (unsigned j : reset_ands) {
+      const aiger_and *a = model->ands + j;
+      gate(lit(0, a->lhs), lit(0, a->rhs0), lit(0, a->rhs1));
+    }
+    for (unsigned j : resets) {
+      r = reset(j);
+      ternary(-resetting, -latch(0, j), lit(0, r));
+      ternary(-resetting, latch(0, j), -lit(0, r));
+    }
+  }
+  if (resetting && !bonly) s->assume(resetting);
+
   for (i = 0; i < model->num_latches; i++) {
     r = reset(i);
-    if (r > 1) continue; // uninitialized
+    if (r > 1) continue; // uninitialized or reset function
     l = latch(0, i) * (r ? 1 : -1);
     if (bonly)
       unary(l);
@@ -242,42 +319,49 @@ static void init(unsigned k) {
   L3 << k << "init";
 }
 
-static int cmp_frames(const void *p, const void *q) {
-  unsigned k = *(unsigned *)p;
-  unsigned l = *(unsigned *)q;
-  int a, b, res;
-  unsigned i;
-
-  for (i = 0; i < model->num_latches; i++) {
-    a = s->val(latch(k, i));
-    b = s->val(latch(l, i));
-    res = a - b;
-    if (res) return res;
+// Latch and input values of a frame, packed into words.
+struct Packed {
+  size_t operator()(const std::vector<uint64_t> &v) const {
+    size_t h = 0;
+    for (uint64_t w : v)
+      h = (h ^ w) * 0x100000001b3ull;
+    return h;
   }
-
-  return 0;
+};
+
+// Adds the diff constraints for all pairs of frames up to k that have the
+// same values in the current model. As the diff constraints, this includes
+// the inputs. Returns whether there were any.
+bool Mcaiger::duplicates(unsigned k) {
+  std::unordered_map<std::vector<uint64_t>, std::vector<unsigned>, Packed>
+      seen;
+  seen.reserve(k + 1);
+  const unsigned n = model->num_latches + model->num_inputs;
+  std::vector<uint64_t> state((n + 63) / 64);
+  bool res = false;
+  for (unsigned j = 0; j <= k; j++) {
+    std::fill(state.begin(), state.end(), 0);
+    for (unsigned i = 0; i < n; i++) {
+      // Variables the frame does not use count as false.
+      const unsigned l = i < model->num_latches
+                             ? model->latches[i].lit
+                             : model->inputs[i - model->num_latches].lit;
+      if (val(j, l) > 0) state[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    std::vector<unsigned> &equal = seen[state];
+    for (unsigned l : equal) {
+      diffs(j, l);
+      nrcs++;
+      res = true;
+    }
+    equal.push_back(j);
+  }
+  return res;
 }
 
-static int sat(unsigned k) {
-  unsigned i;
+int Mcaiger::sat(unsigned k) {
   int res;
 
-  if (rcs || mix) {
-    if (k == nframes) {
-      assert(k == nframes);
-
-      if (k >= sframes) {
-        sframes = sframes ? 2 * sframes : 1;
-        frames = (unsigned *)realloc(frames, sframes * sizeof frames[0]);
-      }
-
-      assert(nframes < sframes);
-      frames[nframes++] = k;
-    }
-
-    assert(nframes == k + 1);
-  }
-
 RESTART:
   res = s->solve();
 
@@ -285,6 +369,8 @@ RESTART:
 
   if (res == 10 && !rcs) return res;
 
+  if (!res && !mix) return res; // terminated
+
   if (!res) {
     assert(mix);
     assert(!rcs);
@@ -298,23 +384,15 @@ RESTART:
   assert(rcs);
   assert(res == 10);
 
-  if (model->num_latches) {
-    qsort(frames, k + 1, sizeof frames[0], cmp_frames);
-    for (i = 0; i < k; i++)
-      if (!cmp_frames(frames + i, frames + i + 1)) {
-        diffs(frames[i], frames[i + 1]);
-        nrcs++;
-        bad(k);
-        goto RESTART;
-      }
-
-    assert(i == k); /* all different */
+  if (model->num_latches && duplicates(k)) {
+    bad(k);
+    goto RESTART;
   }
 
   return 10;
 }
 
-static int step(unsigned k) {
+int Mcaiger::step(unsigned k) {
   int res;
   if (mix && acs)
     picosat_set_ado_conflict_limit(ps, picosat_ado_conflicts(ps) + 1000);
@@ -325,7 +403,7 @@ static int step(unsigned k) {
   return res;
 }
 
-static int base(unsigned k) {
+int Mcaiger::base(unsigned k) {
   int res;
   if (acs) picosat_disable_ado(ps);
   init(k);
@@ -336,15 +414,10 @@ static int base(unsigned k) {
   return res;
 }
 
-void mcaiger_free() { delete s; }
-
-std::pair<bool, int> mcaiger(aiger *aig, unsigned simple_path) {
-  const char *name = 0, *err;
-  unsigned k, maxk = UINT_MAX;
-  int i, cs;
-  double delta;
-  bool bug{};
-  s = new CaDiCaL::Solver();
+Mcaiger::Mcaiger(aiger *aig, unsigned simple_path,
+                 const std::atomic<bool> *stop)
+    : model(aig), s(new CaDiCaL::Solver()), simple_path(simple_path),
+      stop(stop) {
   if (simple_path == 0)
     ncs = 1;
   else if (simple_path == 1)
@@ -353,14 +426,81 @@ std::pair<bool, int> mcaiger(aiger *aig, unsigned simple_path) {
     rcs = 1;
   else
     assert(false);
-  model = aig;
+  s->connect_terminator(this);
+  influence();
+}
+
+Mcaiger::~Mcaiger() {
+  s->disconnect_terminator();
+  delete s;
+}
+
+bool Mcaiger::terminate() {
+  return (stop && *stop) || (finished && *finished);
+}
+
+// Runs the step check of a second instance on its own thread, while this one
+// turns into the base side and unrolls the initial states. It keeps its
+// solver for the stimulus.
+std::optional<std::pair<bool, int>> Mcaiger::concurrently() {
+  // All bounds below checked have no reachable bad state and the step
+  // succeeded at proved. A proof at proved is only valid once checked
+  // reaches it.
+  std::mutex race;
+  unsigned checked = 0, proved = UINT_MAX;
+  std::atomic<bool> done = false;
+  Mcaiger stepper(model, simple_path, stop);
+  stepper.finished = finished = &done;
+  std::thread thread([&] {
+    for (unsigned k = 0; !stepper.terminate(); k++) {
+      stepper.encode(k);
+      stepper.simple(k);
+      if (!stepper.step(k)) continue;
+      L1 << k << "inductive";
+      std::lock_guard<std::mutex> lock(race);
+      proved = k;
+      if (checked >= k) done = true;
+      break;
+    }
+    if (stepper.rcs) {
+      L2 << stepper.nrcs << "refinements of simple path constraints";
+    }
+  });
+  ncs = 1;
+  dcs = rcs = 0;
+  bonly = 1;
+  bool bug = false;
+  unsigned k;
+  for (k = 0; !terminate(); k++) {
+    encode(k);
+    if (base(k)) {
+      L1 << k << "reachable";
+      bug = done = true;
+      break;
+    }
+    if (terminate()) break;
+    std::lock_guard<std::mutex> lock(race);
+    checked = k + 1;
+    if (checked >= proved) done = true;
+  }
+  thread.join();
+  finished = nullptr;
+  if (bug) return std::pair<bool, int>{true, k};
+  if (checked < proved) return {};
+  return std::pair<bool, int>{false, proved};
+}
+
+std::optional<std::pair<bool, int>> Mcaiger::run(bool concurrent) {
+  unsigned k, maxk = UINT_MAX;
+  bool bug{};
+  if (concurrent) return concurrently();
   for (k = 0; k <= maxk; k++) {
+    if (terminate()) return {};
     if (mix && acs && picosat_ado_conflicts(ps) >= 10000) {
       acs = 0;
       rcs = 1;
       picosat_disable_ado(ps);
     }
-    connect(k);
     encode(k);
     simple(k);
     if (step(k)) {
@@ -375,31 +515,46 @@ std::pair<bool, int> mcaiger(aiger *aig, unsigned simple_path) {
     }
   }
   if (rcs || mix) { L2 << nrcs << "refinements of simple path constraints"; }
-  return {bug, k};
+  L2 << allocated << "variables in" << k + 1 << "frames";
+  return std::pair<bool, int>{bug, k};
+}
+
+std::optional<unsigned> Mcaiger::bmc(unsigned bound) {
+  ncs = 1;
+  dcs = rcs = 0;
+  bonly = 1;
+  for (unsigned k = 0; !terminate(); k++) {
+    encode(k);
+    if (base(k)) {
+      L1 << k << "reachable";
+      return k;
+    }
+    if (k == bound) break;
+  }
+  return {};
 }
 
-void stimulus(int k, std::vector<std::vector<unsigned>> &cex) {
+void Mcaiger::stimulus(int k, std::vector<std::vector<unsigned>> &cex) {
   assert(s->status() == 10);
   assert(cex.empty());
   cex.reserve(k + 2);
   unsigned i, j;
-  int lit, l, v;
+  int l, v;
   std::vector<unsigned> frame;
+  // Variables the frame does not use are left out, so they are don't cares.
   for (i = 0; i < model->num_latches; i++) {
-    lit = latch(0, i);
-    v = s->val(lit) < 0;
     l = model->latches[i].lit;
-    frame.push_back(l + v);
+    if (!(v = val(0, l))) continue;
+    frame.push_back(l + (v < 0));
   }
   cex.push_back(frame);
   for (i = 0; i <= k; i++) {
     frame.clear();
     for (j = 0; j < model->num_inputs; j++) {
-      lit = input(i, j);
-      LV5(i, j, l, s->val(lit));
-      v = s->val(lit) < 0;
       l = model->inputs[j].lit;
-      frame.push_back(l + v);
+      LV5(i, j, l, val(i, l));
+      if (!(v = val(i, l))) continue;
+      frame.push_back(l + (v < 0));
     }
     cex.push_back(frame);
   }
@@ -1,8 +1,77 @@
+#pragma once
+
 #include "aiger.hpp"
+#include "cadical.hpp"
 
+#include <atomic>
+#include <optional>
 #include <utility>
 #include <vector>
 
-void mcaiger_free();
-std::pair<bool, int> mcaiger(aiger *aig, unsigned simple_path);
-void stimulus(int k, std::vector<std::vector<unsigned>> &cex);
+// One k-induction run on a model that is only read, so several instances can
+// run on separate threads. Once stop is set the run is abandoned.
+class Mcaiger : CaDiCaL::Terminator {
+  aiger *model;
+  CaDiCaL::Solver *s;
+  unsigned simple_path;
+  const std::atomic<bool> *stop;
+  // Set once the concurrent run this instance is part of is decided.
+  const std::atomic<bool> *finished{};
+  int bonly{};
+  int acs{}, mix{};
+  int ncs{}, dcs{}, rcs{};
+  unsigned nrcs{};
+  // Solver variables of the model variables in each frame, 0 if not yet used.
+  // Variable 1 is the constant.
+  std::vector<std::vector<int>> vars;
+  int allocated = 1;
+  // The ands and the latches connected to the previous frame by their
+  // distance from bad.
+  std::vector<std::vector<unsigned>> ands, connections;
+  // The latches with a reset function, the ands in these functions and the
+  // literal guarding them in frame 0, which is 0 until they are encoded.
+  std::vector<unsigned> resets, reset_ands;
+  int resetting{};
+
+  bool terminate() override;
+  void influence();
+  int lit(unsigned k, unsigned l);
+  int val(unsigned k, unsigned l);
+  int input(unsigned k, unsigned i);
+  int latch(unsigned k, unsigned i);
+  int next(unsigned k, unsigned i);
+  int reset(unsigned i);
+  int output(unsigned k, unsigned i);
+  int constraint(unsigned k, unsigned i);
+  void unary(int a);
+  void binary(int a, int b);
+  void ternary(int a, int b, int c);
+  void gate(int lhs, int rhs0, int rhs1);
+  void eq(int lhs, int rhs);
+  void layer(unsigned k, unsigned d);
+  void encode(unsigned k);
+  void ado(unsigned k);
+  void diffs(unsigned k, unsigned l);
+  void diffsk(unsigned k);
+  void simple(unsigned k);
+  void bad(unsigned k);
+  void init(unsigned k);
+  bool duplicates(unsigned k);
+  int sat(unsigned k);
+  int step(unsigned k);
+  int base(unsigned k);
+  std::optional<std::pair<bool, int>> concurrently();
+
+public:
+  Mcaiger(aiger *aig, unsigned simple_path,
+          const std::atomic<bool> *stop = nullptr);
+  ~Mcaiger();
+  // Whether bad is reachable and the bound k at which this was decided, or
+  // nothing if stopped. With concurrent base and step run on separate threads.
+  std::optional<std::pair<bool, int>> run(bool concurrent = false);
+  // The smallest k up to bound at which bad is reachable from the initial
+  // states, without step checks or simple path constraints. Without a bound,
+  // that is with the maximum, this does not return on safe models.
+  std::optional<unsigned> bmc(unsigned bound);
+  void stimulus(int k, std::vector<std::vector<unsigned>> &cex);
+};
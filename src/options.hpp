@@ -11,10 +11,22 @@
 // <let ((beg (progn (next-line 3) (bol))) (end (progn (forward-paragraph) (point)))) (shell-command-on-region beg end "sort -k 2" t t) (align-regexp beg end "\\(,\\s-*\\) " 1 1 t)>
 //                     Name   Def Min Max Description
 #define OPTIONS \
+  OPTION(unsigned, bads,        1, 1, INF, "maximum bad cubes IC3 blocks in one batch") \
+  OPTION(bool,     bmc,         0, 0, 1, "use bounded model checking") \
+  OPTION(unsigned, bound,       INF, 0, INF, "maximum BMC bound, by default BMC runs until it finds a bug") \
   OPTION(bool,     certificate, 1, 0, 1, "produce witness circuit") \
+  OPTION(bool,     concurrent,  0, 0, 1, "run k-Induction base and step on separate threads") \
+  OPTION(unsigned, ctg,         3, 0, INF, "maximum CTGs blocked per IC3 literal drop") \
+  OPTION(unsigned, ctg_depth,   1, 0, INF, "maximum IC3 CTG recursion depth") \
+  OPTION(unsigned, ctp,         0, 0, INF, "maximum CTPs blocked per forwarded IC3 cube") \
   OPTION(bool,     kind,        0, 0, 1, "use k-Induction") \
+  OPTION(bool,     lift,        0, 0, 1, "lift IC3 states with SAT instead of ternary simulation") \
   LOGOPT(bool,     location,    1, 0, 1, "use location for logging") \
+  OPTION(bool,     minimize,    0, 0, 1, "shrink the IC3 invariant for the certificate") \
   OPTION(unsigned, paths,       2, 0, 2, "type of simple path constrains") \
+  OPTION(bool,     portfolio,   0, 0, 1, "race all k-Induction simple path variants") \
+  OPTION(bool,     single,      0, 0, 1, "use one IC3 solver with frame activation literals") \
+  OPTION(unsigned, threads,     1, 1, INF, "number of IC3 forwarding threads") \
   OPTION(bool,     trace,       1, 0, 1, "produce cex trace") \
   OPTION(bool,     unique,      0, 0, 1, "always use unique kind witness construction") \
   LOGOPT(unsigned, verbosity,   2, 0, 5, "verbosity level")
@@ -46,50 +46,142 @@ bool validSimulation(aiger_and ands[], const unsigned num_ands,
   return true;
 }
 
+// X  -X    X  -X   1  -1   0  -0
+static constexpr ternary AND_NEG[] = {
+    X,  X,  X,  X,  X,  X0, X0, X,  //  X
+    X,  X,  X,  X,  X,  X0, X0, X,  // -X
+    X,  X,  X,  X,  X,  X0, X0, X,  //  X
+    X,  X,  X,  X,  X,  X0, X0, X,  // -X
+    X,  X,  X,  X,  X1, X0, X0, X1, //  1
+    X0, X0, X0, X0, X0, X0, X0, X0, // -1
+    X0, X0, X0, X0, X0, X0, X0, X0, //  0
+    X,  X,  X,  X,  X1, X0, X0, X1, // -0
+};
+
+inline ternary evaluate(const aiger_and &a, const std::vector<ternary> &s) {
+  const unsigned L{a.rhs0}, R{a.rhs1};
+  const unsigned l = s[L >> 1] | (L & 1u);
+  const unsigned r = s[R >> 1] | (R & 1u);
+  return AND_NEG[r + 8 * l];
+}
+
 void propagate(aiger_and *ands, const unsigned num_ands,
                std::vector<ternary> &s) {
-  // X  -X    X  -X   1  -1   0  -0
-  static constexpr ternary AND_NEG[] = {
-      X,  X,  X,  X,  X,  X0, X0, X,  //  X
-      X,  X,  X,  X,  X,  X0, X0, X,  // -X
-      X,  X,  X,  X,  X,  X0, X0, X,  //  X
-      X,  X,  X,  X,  X,  X0, X0, X,  // -X
-      X,  X,  X,  X,  X1, X0, X0, X1, //  1
-      X0, X0, X0, X0, X0, X0, X0, X0, // -1
-      X0, X0, X0, X0, X0, X0, X0, X0, //  0
-      X,  X,  X,  X,  X1, X0, X0, X1, // -0
-  };
-  for (unsigned int i = 0; i < num_ands; i++) {
-    const unsigned L{ands[i].rhs0}, R{ands[i].rhs1};
-    const unsigned l = s[L >> 1] | (L & 1u);
-    const unsigned r = s[R >> 1] | (R & 1u);
-    s[ands[i].lhs >> 1] = AND_NEG[r + 8 * l];
+  for (unsigned int i = 0; i < num_ands; i++)
+    s[ands[i].lhs >> 1] = evaluate(ands[i], s);
+}
+
+Fanout::Fanout(aiger *model)
+    : offsets(model->maxvar + 2), level(model->num_ands) {
+  assert(aiger_is_reencoded(model));
+  const unsigned aBegin = model->num_inputs + model->num_latches + 1;
+  for (unsigned i = 0; i < model->num_ands; ++i) {
+    const aiger_and &a = model->ands[i];
+    offsets[IDX(a.rhs0) + 1]++;
+    if (IDX(a.rhs1) != IDX(a.rhs0)) offsets[IDX(a.rhs1) + 1]++;
+  }
+  for (unsigned v = 1; v < offsets.size(); ++v)
+    offsets[v] += offsets[v - 1];
+  gates.resize(offsets.back());
+  std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+  // Reencoded gates are ordered topologically.
+  for (unsigned i = 0; i < model->num_ands; ++i) {
+    const unsigned x = IDX(model->ands[i].rhs0), y = IDX(model->ands[i].rhs1);
+    gates[fill[x]++] = i;
+    if (y != x) gates[fill[y]++] = i;
+    unsigned l = 0;
+    if (x >= aBegin) l = level[x - aBegin];
+    if (y >= aBegin) l = std::max(l, level[y - aBegin]);
+    level[i] = l + 1;
+    depth = std::max(depth, l + 1);
   }
 }
-std::vector<unsigned> reduce(aiger *model,
-                             const std::vector<unsigned> &obligations,
-                             std::vector<ternary> &s) {
-  const unsigned lBegin = model->num_inputs + 1; // const 1
-  const unsigned lEnd = lBegin + model->num_latches;
-  for (unsigned i = lBegin; i < lEnd; ++i) {
+
+// Tries to set the variables begin..end in the fully simulated s to X.
+static void eliminate(aiger *model, const Fanout &fanout,
+                      const std::vector<unsigned> &obligations,
+                      std::vector<ternary> &s, unsigned begin, unsigned end) {
+  std::vector<bool> watched(s.size()), queued(model->num_ands);
+  for (unsigned l : obligations)
+    watched[IDX(l)] = true;
+  // Gates to simulate by level, and the changed variables with their values.
+  std::vector<std::vector<unsigned>> buckets(fanout.depth + 1);
+  std::vector<std::pair<unsigned, ternary>> trail;
+  unsigned highest;
+  auto schedule = [&](unsigned v) {
+    for (unsigned j = fanout.offsets[v]; j < fanout.offsets[v + 1]; ++j) {
+      const unsigned g = fanout.gates[j];
+      if (queued[g]) continue;
+      queued[g] = true;
+      buckets[fanout.level[g]].push_back(g);
+      highest = std::max(highest, fanout.level[g]);
+    }
+  };
+  for (unsigned i = begin; i < end; ++i) {
     // TODO skip those that are in obligations?
     const ternary v = s[i];
-    assert(v);
+    if (!v) continue;
     s[i] = X;
-    L3 << "try to eliminate latch" << (i << 1);
-    propagate(model->ands, model->num_ands, s);
-    const bool covered =
-        std::none_of(obligations.begin(), obligations.end(),
-                     [&s](const unsigned l) { return !(s[IDX(l)]); });
+    L3 << "try to eliminate" << (i << 1);
+    bool covered = !watched[i];
+    trail.clear();
+    highest = 0;
+    if (covered) schedule(i);
+    for (unsigned l = 1; l <= highest; ++l) {
+      for (unsigned g : buckets[l]) {
+        queued[g] = false;
+        if (!covered) continue;
+        const aiger_and &a = model->ands[g];
+        const ternary t = evaluate(a, s);
+        if (t == s[IDX(a.lhs)]) continue;
+        // Values can only change to X.
+        assert(!t);
+        trail.emplace_back(IDX(a.lhs), s[IDX(a.lhs)]);
+        s[IDX(a.lhs)] = t;
+        if (watched[IDX(a.lhs)])
+          covered = false;
+        else
+          schedule(IDX(a.lhs));
+      }
+      buckets[l].clear();
+    }
     LI3(covered) << "eliminated" << (i << 1);
-    if (!covered) s[i] = v;
+    if (covered) continue;
+    s[i] = v;
+    for (auto [u, t] : trail)
+      s[u] = t;
   }
+}
 
+// The literals of the variables begin..end that are not X in s.
+static std::vector<unsigned> literals(const std::vector<ternary> &s,
+                                      unsigned begin, unsigned end) {
   std::vector<unsigned> cube;
-  cube.reserve(model->num_latches);
-  for (unsigned i = lBegin; i < lEnd; ++i) {
+  cube.reserve(end - begin);
+  for (unsigned i = begin; i < end; ++i) {
     if (!(s[i])) continue;
     cube.push_back((i << 1) | XTS(s[i]));
   }
   return cube;
 }
+
+std::vector<unsigned> reduce(aiger *model, const Fanout &fanout,
+                             const std::vector<unsigned> &obligations,
+                             std::vector<ternary> &s) {
+  const unsigned lBegin = model->num_inputs + 1; // const 1
+  const unsigned lEnd = lBegin + model->num_latches;
+  propagate(model->ands, model->num_ands, s);
+  eliminate(model, fanout, obligations, s, lBegin, lEnd);
+  return literals(s, lBegin, lEnd);
+}
+
+std::vector<unsigned> reduceInputs(aiger *model, const Fanout &fanout,
+                                   const std::vector<unsigned> &obligations,
+                                   std::vector<ternary> &s) {
+  const unsigned lBegin = model->num_inputs + 1; // const 1
+  propagate(model->ands, model->num_ands, s);
+  if (std::all_of(obligations.begin(), obligations.end(),
+                  [&s](unsigned l) { return s[IDX(l)]; }))
+    eliminate(model, fanout, obligations, s, 1, lBegin);
+  return literals(s, 1, lBegin);
+}
@@ -51,5 +51,27 @@ std::ostream &operator<<(std::ostream &out, const std::vector<ternary> &v);
 // the value of all and-gates, given by *ands and num_ands, is computed and
 // written to s. The vector s should be sized correctly before this is called.
 void propagate(aiger_and *ands, const unsigned num_ands, std::vector<ternary> &s);
-std::vector<unsigned> reduce(aiger *model, const std::vector<unsigned> &obligations,
-           std::vector<ternary> &s);
+
+// Fanout of the variables in CSR layout, the gates reading variable v are
+// ands[gates[offsets[v]]] up to ands[gates[offsets[v + 1]]]. Gates are
+// scheduled by their topological level, inputs and latches are at level 0.
+struct Fanout {
+  std::vector<unsigned> offsets, gates, level;
+  unsigned depth = 0;
+  Fanout(aiger *model);
+};
+
+// Tries to set each latch in s to X, which is kept if all obligations are
+// still implied. Only the gates affected by a change are simulated, which is
+// undone if an obligation becomes X. Only inputs and latches in s need to be
+// set. Returns the cube of the remaining latches.
+std::vector<unsigned> reduce(aiger *model, const Fanout &fanout,
+                             const std::vector<unsigned> &obligations,
+                             std::vector<ternary> &s);
+
+// Like reduce for the inputs, where s holds the reduced latches. Returns the
+// cube of the remaining inputs, which are all inputs if the obligations are
+// not implied to begin with.
+std::vector<unsigned> reduceInputs(aiger *model, const Fanout &fanout,
+                                   const std::vector<unsigned> &obligations,
+                                   std::vector<ternary> &s);
@@ -1,5 +1,6 @@
 #include "aiger.hpp"
 #include "banner.hpp"
+#include "bmc.hpp"
 #include "cadical.hpp"
 #include "ic3.hpp"
 #include "kind.hpp"
@@ -16,10 +17,17 @@ int main(int argc, char *argv[]) {
   std::vector<std::vector<unsigned>> cex;
   bool bug;
   aiger *witness{};
-  if (options.kind)
-    bug = kind(*model, witness, cex, options.paths, options.unique);
+  if (options.bmc) {
+    bug = bmc(*model, cex, options.bound);
+    if (!bug) {
+      L0 << "exit 0\n";
+      return 0;
+    }
+  } else if (options.kind)
+    bug = kind(*model, witness, cex, options.paths, options.unique,
+               options.concurrent, options.portfolio);
   else
-    bug = ic3(*model, cex);
+    bug = ic3(*model, cex, &options);
   if (bug) {
     if (options.trace) write_witness(*model, cex, options.witness);
     L0 << "exit 10\n";